@@ -0,0 +1,183 @@
+/*
+ * SPDX-FileCopyrightText: 2026 KDE Connect iOS contributors
+ *
+ * SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+ */
+
+//
+//  ConcurrentPayloadTransferTests.swift
+//  KDE Connect Tests
+//
+
+import XCTest
+import CocoaAsyncSocket
+@testable import KDE_Connect
+
+/// Benchmarks LanLink's payload path end to end: two LanLinks talk over a loopback
+/// control socket, and every payload goes through the payload server, TCP connect,
+/// TLS handshake and chunked file I/O on its own transfer queue, as with a real peer.
+/// Concurrent transfers are compared against the same transfers run one after another.
+///
+/// Skipped in the shared scheme, run it explicitly, e.g. with
+/// `xcodebuild test -only-testing:"KDE ConnectTests/ConcurrentPayloadTransferTests"`.
+class ConcurrentPayloadTransferTests: XCTestCase {
+    private let iterations = 3
+
+    /// Bulk transfers, mostly file I/O and TLS record processing
+    func testConcurrentTransfersOutpaceSequentialTransfers() throws {
+        try compareConcurrentAgainstSequential(transferCount: 4, bytesPerTransfer: 2 * 1024 * 1024)
+    }
+
+    /// Tiny payloads, mostly connecting and TLS handshakes
+    func testConcurrentHandshakesOutpaceSequentialHandshakes() throws {
+        try compareConcurrentAgainstSequential(transferCount: 16, bytesPerTransfer: 1)
+    }
+
+    private func compareConcurrentAgainstSequential(transferCount: Int, bytesPerTransfer: Int) throws {
+        let pair = try LoopbackLinkPair(bytesPerTransfer: bytesPerTransfer)
+        defer { pair.tearDown() }
+
+        // Best of a few runs each, the first one also warms up both links
+        var concurrent = TimeInterval.infinity
+        var sequential = TimeInterval.infinity
+        for _ in 0..<iterations {
+            sequential = min(sequential, try pair.transfer(count: transferCount, concurrently: false))
+            concurrent = min(concurrent, try pair.transfer(count: transferCount, concurrently: true))
+        }
+        print("\(transferCount) × \(bytesPerTransfer) bytes: concurrent \(concurrent)s, sequential \(sequential)s, \(ProcessInfo.processInfo.activeProcessorCount) cores")
+        XCTAssertLessThan(concurrent, sequential,
+                          "\(transferCount) concurrent transfers should finish sooner than one after another")
+    }
+}
+
+/// A sending and a receiving LanLink connected over loopback.
+private class LoopbackLinkPair: NSObject, GCDAsyncSocketDelegate, LinkDelegate {
+    private static let timeout: TimeInterval = 60
+
+    private let bytesPerTransfer: Int
+    private let payloadURL: URL
+    // Like LanLinkProvider's socketQueue, which owns the control sockets
+    private let controlQueue = DispatchQueue(label: "org.kde.kdeconnect.tests.controlQueue")
+    private let acceptedSocket = DispatchSemaphore(value: 0)
+    private let transferDone = DispatchSemaphore(value: 0)
+    private let errorsQueue = DispatchQueue(label: "org.kde.kdeconnect.tests.errorsQueue")
+    private var errors: [Error] = []
+    private var listener: GCDAsyncSocket?
+    private var serverSocket: GCDAsyncSocket?
+    private var sender: LanLink?
+    private var receiver: LanLink?
+
+    init(bytesPerTransfer: Int) throws {
+        self.bytesPerTransfer = bytesPerTransfer
+        payloadURL = FileManager.default.temporaryDirectory
+            .appendingPathComponent(UUID().uuidString)
+            .appendingPathExtension("bin")
+        super.init()
+        try Data(repeating: 0x4B, count: bytesPerTransfer).write(to: payloadURL)
+
+        let listener = GCDAsyncSocket(delegate: self, delegateQueue: controlQueue)
+        self.listener = listener
+        try listener.accept(onInterface: "127.0.0.1", port: 0)
+        let clientSocket = GCDAsyncSocket(delegate: self, delegateQueue: controlQueue)
+        try clientSocket.connect(toHost: "127.0.0.1", onPort: listener.localPort)
+        guard acceptedSocket.wait(timeout: .now() + Self.timeout) == .success,
+              let serverSocket = serverSocket else {
+            throw POSIXError(.ETIMEDOUT)
+        }
+
+        // Nothing is stored in the keychain for these IDs, so the receiver trusts the sender's certificate
+        let cert = CertificateService.shared.getHostCertificate()
+        sender = LanLink(clientSocket, deviceInfo: Self.deviceInfo(cert: cert))
+        receiver = LanLink(serverSocket, deviceInfo: Self.deviceInfo(cert: cert))
+        sender?.linkDelegate = self
+        receiver?.linkDelegate = self
+    }
+
+    private static func deviceInfo(cert: SecCertificate) -> DeviceInfo {
+        DeviceInfo(id: "ConcurrentPayloadTransferTests-\(UUID().uuidString)",
+                   name: "Benchmark peer", type: .unknown, cert: cert,
+                   protocolVersion: 8, incomingCapabilities: [], outgoingCapabilities: [])
+    }
+
+    func tearDown() {
+        listener?.disconnect()
+        sender?.linkDelegate = nil
+        receiver?.linkDelegate = nil
+        sender?.disconnect()
+        receiver?.disconnect()
+        try? FileManager.default.removeItem(at: payloadURL)
+    }
+
+    /// Returns the wall time until every payload arrived on the receiving side.
+    func transfer(count: Int, concurrently: Bool) throws -> TimeInterval {
+        let start = Date()
+        if concurrently {
+            for _ in 0..<count {
+                try send()
+            }
+            for _ in 0..<count {
+                try waitForTransfer()
+            }
+        } else {
+            for _ in 0..<count {
+                try send()
+                try waitForTransfer()
+            }
+        }
+        return -start.timeIntervalSinceNow
+    }
+
+    private func send() throws {
+        let np = NetworkPacket(type: .share)
+        np.setObject(payloadURL.lastPathComponent, forKey: "filename")
+        np.payloadPath = payloadURL
+        np._PayloadSize = bytesPerTransfer
+        guard sender?.send(np, tag: Int(PACKET_TAG_SHARE)) == true else {
+            throw POSIXError(.ENOTCONN)
+        }
+    }
+
+    private func waitForTransfer() throws {
+        guard transferDone.wait(timeout: .now() + Self.timeout) == .success else {
+            throw POSIXError(.ETIMEDOUT)
+        }
+        if let error = errorsQueue.sync(execute: { errors.first }) {
+            throw error
+        }
+    }
+
+    private func fail(with error: Error) {
+        errorsQueue.sync {
+            errors.append(error)
+        }
+        transferDone.signal()
+    }
+
+    // MARK: GCDAsyncSocketDelegate, only until the links take over the control sockets
+
+    func socket(_ sock: GCDAsyncSocket, didAcceptNewSocket newSocket: GCDAsyncSocket) {
+        serverSocket = newSocket
+        acceptedSocket.signal()
+    }
+
+    // MARK: LinkDelegate
+
+    func onPacketReceived(_ np: NetworkPacket) {
+        guard np.type == .share, let url = np.payloadPath else { return }
+        let size = (try? FileManager.default.attributesOfItem(atPath: url.path)[.size] as? Int) ?? -1
+        try? FileManager.default.removeItem(at: url)
+        if size == bytesPerTransfer {
+            transferDone.signal()
+        } else {
+            fail(with: POSIXError(.EIO))
+        }
+    }
+
+    func onPacket(_ np: NetworkPacket, sendWithPacketTag tag: Int, failedWithError error: Error) {
+        fail(with: error)
+    }
+
+    func onReceivingPayload(_ payload: FileTransferItem, failedWithError error: Error) {
+        fail(with: error)
+    }
+}
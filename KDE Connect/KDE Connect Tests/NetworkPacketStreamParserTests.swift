@@ -0,0 +1,148 @@
+/*
+ * SPDX-FileCopyrightText: 2026 KDE Connect iOS contributors
+ *
+ * SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+ */
+
+//
+//  NetworkPacketStreamParserTests.swift
+//  KDE Connect Tests
+//
+
+import XCTest
+@testable import KDE_Connect
+
+class NetworkPacketStreamParserTests: XCTestCase {
+    // Mirror NetworkPacket.h, the expressions there aren't imported into Swift
+    private let maxPacketSize = 32 * 1024 * 1024
+    private let packetMemoryBudget = 1024 * 1024
+    private let lazyBodyValueSize = 64 * 1024
+
+    private func packet(_ body: [String: Any]) -> Data {
+        let np = NetworkPacket(type: .ping)
+        for (key, value) in body {
+            np.setObject(value, forKey: key)
+        }
+        return np.serialize()!
+    }
+
+    private func parse(_ chunks: [Data],
+                       with parser: NetworkPacketStreamParser = NetworkPacketStreamParser(memoryBudget: UInt(1024 * 1024))) -> [NetworkPacket] {
+        var packets: [NetworkPacket] = []
+        for chunk in chunks {
+            parser.append(chunk) { packets.append($0) }
+        }
+        return packets
+    }
+
+    private func spillFiles() throws -> [String] {
+        try FileManager.default.contentsOfDirectory(atPath: NSTemporaryDirectory())
+            .filter { $0.hasSuffix(".kdeconnect-packet") }
+    }
+
+    func testLineFeedAcrossChunkBoundaries() {
+        let data = packet(["message": "hello"])
+        // Split inside the packet, and right before the LF so it arrives alone
+        for split in [1, data.count / 2, data.count - 1] {
+            let packets = parse([data.prefix(split), data.suffix(from: split)])
+            XCTAssertEqual(packets.count, 1, "split at \(split)")
+            XCTAssertEqual(packets.first?.string(forKey: "message"), "hello")
+        }
+    }
+
+    func testMultiplePacketsInOneChunk() {
+        var chunk = Data()
+        for index in 0..<3 {
+            chunk.append(packet(["index": index]))
+        }
+        let first = packet(["index": 3])
+        // Ends with the start of a fourth packet, finished by the next chunk
+        chunk.append(first.prefix(5))
+
+        let parser = NetworkPacketStreamParser(memoryBudget: UInt(packetMemoryBudget))
+        var packets = parse([chunk], with: parser)
+        XCTAssertEqual(packets.map { $0.integer(forKey: "index") }, [0, 1, 2])
+        packets = parse([first.suffix(from: 5)], with: parser)
+        XCTAssertEqual(packets.map { $0.integer(forKey: "index") }, [3])
+    }
+
+    func testPacketOverMemoryBudgetSpillsToDisk() throws {
+        let payload = String(repeating: "x", count: 4096)
+        let data = packet(["payload": payload])
+        let parser = NetworkPacketStreamParser(memoryBudget: 1024)
+        let existing = Set(try spillFiles())
+
+        var packets = parse([data.dropLast()], with: parser)
+        XCTAssertTrue(packets.isEmpty)
+        XCTAssertEqual(Set(try spillFiles()).subtracting(existing).count, 1)
+
+        packets = parse([data.suffix(1)], with: parser)
+        XCTAssertEqual(packets.count, 1)
+        XCTAssertEqual(packets.first?.string(forKey: "payload"), payload)
+        XCTAssertTrue(Set(try spillFiles()).subtracting(existing).isEmpty)
+    }
+
+    func testPacketOverMaxSizeIsDiscarded() throws {
+        let parser = NetworkPacketStreamParser(memoryBudget: UInt(packetMemoryBudget))
+        let existing = Set(try spillFiles())
+        let chunk = Data(repeating: UInt8(ascii: "a"), count: packetMemoryBudget)
+        var packets: [NetworkPacket] = []
+        for _ in 0...(maxPacketSize / chunk.count) {
+            packets += parse([chunk], with: parser)
+        }
+        XCTAssertTrue(packets.isEmpty)
+        XCTAssertTrue(Set(try spillFiles()).subtracting(existing).isEmpty)
+
+        // Rest of the oversized packet, then a normal one in the same chunk
+        var tail = Data("aaaa\n".utf8)
+        tail.append(packet(["message": "after"]))
+        packets = parse([tail], with: parser)
+        XCTAssertEqual(packets.count, 1)
+        XCTAssertEqual(packets.first?.string(forKey: "message"), "after")
+    }
+
+    func testLazyBodyValuesMatchEagerParse() throws {
+        // Escapes must not end the value early or throw off later keys
+        let tricky = String(repeating: "\"quoted\" back\\slash \\\" \u{00e9}\n", count: lazyBodyValueSize / 16)
+        let body: [String: Any] = [
+            "tricky": tricky,
+            "key\"with\\escapes": tricky + "!",
+            "short": "short \"value\"",
+            "number": 42,
+            "nested": ["inner": tricky],
+        ]
+        let data = packet(body)
+        let eagerPacket = try XCTUnwrap(JSONSerialization.jsonObject(with: data) as? [String: Any])
+        let eagerBody = try XCTUnwrap(eagerPacket["body"] as? NSDictionary)
+
+        let packets = parse([data])
+        XCTAssertEqual(packets.count, 1)
+        let np = try XCTUnwrap(packets.first)
+
+        for key in eagerBody.allKeys as! [String] {
+            XCTAssertTrue(np.bodyHasKey(key), key)
+            XCTAssertEqual(np.object(forKey: key) as? NSObject, eagerBody[key] as? NSObject, key)
+        }
+        XCTAssertEqual(np.string(forKey: "tricky"), tricky)
+        XCTAssertEqual(np._Body as NSDictionary, eagerBody)
+        XCTAssertEqual(np.object(forKey: "key\"with\\escapes") as? String, tricky + "!")
+    }
+
+    func testLargeBodyValuesAreDecodedOnAccess() throws {
+        let plain = String(repeating: "z", count: lazyBodyValueSize + 1)
+        let data = packet(["plain": plain, "short": "short"])
+        // Bytes we can still change after parsing, bridged to NSData without a copy
+        let bytes = UnsafeMutableRawBufferPointer.allocate(byteCount: data.count, alignment: 1)
+        defer { bytes.deallocate() }
+        data.copyBytes(to: bytes)
+        let np = try XCTUnwrap(NetworkPacket.unserialize(Data(bytesNoCopy: bytes.baseAddress!,
+                                                                count: bytes.count,
+                                                                deallocator: .none)))
+        XCTAssertEqual(np.string(forKey: "short"), "short")
+
+        // Only "plain" has a "z" in it, an eager parse would already have copied it out
+        let index = try XCTUnwrap(bytes.firstIndex(of: UInt8(ascii: "z")))
+        bytes[index] = UInt8(ascii: "y")
+        XCTAssertEqual(np.string(forKey: "plain"), "y" + plain.dropFirst())
+    }
+}
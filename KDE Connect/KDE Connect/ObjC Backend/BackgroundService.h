@@ -52,6 +52,13 @@
 //- (NSArray*) getDevicePluginViews:(NSString*)deviceId viewController:(UIViewController*)vc;
 - (NSDictionary<NSString *, NSDictionary<NSString *, NSString *> *> *) getDevicesLists;
 - (void) reloadAllPlugins;
+/// Serializes `np` once and sends the same bytes to every paired and reachable
+/// device for which `predicate` returns YES.
+/// @return For each of those devices' ID, whether the packet got queued for sending.
+/// Completion is reported through the devices as for sendPacket:tag:.
+- (NSDictionary<NSString *, NSNumber *> *) broadcastPacket:(NetworkPacket *)np
+                                                       tag:(long)tag
+                                      toDevicesPassingTest:(BOOL (NS_NOESCAPE ^)(Device *device))predicate;
 
 - (void) onNetworkChange;
 @end
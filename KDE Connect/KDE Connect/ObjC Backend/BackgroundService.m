@@ -394,6 +394,29 @@
     }
 }
 
+- (NSDictionary<NSString *, NSNumber *> *) broadcastPacket:(NetworkPacket *)np
+                                                       tag:(long)tag
+                                      toDevicesPassingTest:(BOOL (NS_NOESCAPE ^)(Device *device))predicate
+{
+    NSMutableDictionary<NSString *, NSNumber *> *results = [NSMutableDictionary dictionary];
+    // Immutable, so links can queue it without copying
+    NSData *data = [[np serialize] copy];
+    if (!data) {
+        return results;
+    }
+    for (Device *device in [_devices allValues]) {
+        if (![device isPaired] || ![device isReachable] || !predicate(device)) {
+            continue;
+        }
+        BOOL queued = [device sendSerializedPacket:data ofPacket:np tag:tag];
+        results[device._deviceInfo.id] = [NSNumber numberWithBool:queued];
+    }
+    os_log_with_type(logger, self.debugLogLevel,
+                     "bg broadcast %{public}@ to %lu devices",
+                     np.type, (unsigned long)results.count);
+    return results;
+}
+
 - (void) reloadAllPlugins
 {
     for (Device* device in _devices) { //_visibleDevices
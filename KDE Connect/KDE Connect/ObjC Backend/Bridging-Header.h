@@ -12,6 +12,7 @@
 #import "BackgroundService.h"
 #import "Device.h"
 #import "NetworkPacket.h"
+#import "LanLink.h"
 #import "KeychainItemWrapper.h"
 
 OSStatus generateSecIdentityForUUID(NSString *uuid);
@@ -96,6 +96,7 @@ typedef NS_ENUM(NSUInteger, PairStatus)
 - (void)onPacketReceived:(NetworkPacket *)np;
 - (void)onLinkDestroyed:(BaseLink *)link;
 - (BOOL)sendPacket:(NetworkPacket *)np tag:(long)tag;
+- (BOOL)sendSerializedPacket:(NSData *)data ofPacket:(NetworkPacket *)np tag:(long)tag;
 - (BOOL)isReachable;
 
 #pragma mark Pairing-related Functions
@@ -125,7 +125,7 @@ static const NSInteger allowedTimestampDifferenceSeconds = 1800; // 30 minutes
     }
 }
 
-// FIXME: This doesn't get called when connection is cut (e.g wifi off) from the remote device
+// When the remote device drops off (e.g wifi off), LanLink notices through missed heartbeats
 - (void) onLinkDestroyed:(BaseLink *)link
 {
     os_log_with_type(logger, self.debugLogLevel, "device on link destroyed");
@@ -135,6 +135,19 @@ static const NSInteger allowedTimestampDifferenceSeconds = 1800; // 30 minutes
         count = [_links count];
     }
     os_log_with_type(logger, self.debugLogLevel, "remove link ; %lu remaining", count);
+    // Fail over what was still queued on the dead link
+    [link drainUnsentPackets:^(NetworkPacket *np, long tag) {
+        if (count == 0 || np.payloadPath != nil) {
+            os_log_with_type(self->logger, OS_LOG_TYPE_INFO,
+                             "dropping unsent %{public}@ packet", np.type);
+            [self onPacket:np sendWithPacketTag:tag
+           failedWithError:[NSError errorWithDomain:NSPOSIXErrorDomain
+                                               code:ETIMEDOUT
+                                           userInfo:nil]];
+            return;
+        }
+        [self sendPacket:np tag:tag];
+    }];
     if (count == 0) {
         os_log_with_type(logger, self.debugLogLevel, "no available link");
         if (deviceDelegate) {
@@ -162,6 +175,19 @@ static const NSInteger allowedTimestampDifferenceSeconds = 1800; // 30 minutes
     return false;
 }
 
+- (BOOL) sendSerializedPacket:(NSData *)data ofPacket:(NetworkPacket *)np tag:(long)tag
+{
+    os_log_with_type(logger, self.debugLogLevel, "device send serialized packet");
+    @synchronized (_links) {
+        for (BaseLink *link in _links) {
+            if ([link sendSerializedPacket:data ofPacket:np tag:tag]) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 - (void)onPacket:(NetworkPacket *)np sentWithPacketTag:(long)tag {
     os_log_with_type(logger, self.debugLogLevel, "device on send success");
     if (tag==PACKET_TAG_PAIR) {
@@ -55,6 +55,8 @@
 #define MAX_TCP_PORT             1764
 #define MAX_IDENTITY_PACKET_SIZE 8192
 #define MAX_PACKET_SIZE          32 * 1024 * 1024
+#define PACKET_MEMORY_BUDGET     (1024 * 1024)      /* Per link, bigger packets are spilled to disk */
+#define LAZY_BODY_VALUE_SIZE     (64 * 1024)        /* Bigger body strings are decoded on access */
 
 #pragma mark - Packet Types
 
@@ -125,8 +127,29 @@ FOUNDATION_EXPORT NetworkPacketType const NetworkPacketTypeRunCommand;
 
 #pragma mark Serialize
 - (nullable NSData *) serialize;
+/// Top-level body strings longer than LAZY_BODY_VALUE_SIZE are not decoded
+/// until accessed through objectForKey: and friends; `data` is kept alive
+/// (and may be memory-mapped) for as long as such values are pending.
+/// Accessing `_Body` directly decodes all of them.
 + (nullable NetworkPacket *) unserialize:(NSData *)data;
 
 @end
 
+#pragma mark -
+
+/// Splits a TCP stream into NetworkPackets without holding more than
+/// `memoryBudget` bytes of a single packet in memory; the rest of an
+/// oversized packet is written to a temporary file and memory-mapped
+/// for unserializing. Not thread safe, use from the socket's queue only.
+@interface NetworkPacketStreamParser : NSObject
+
+- (instancetype)init NS_UNAVAILABLE;
+- (instancetype)initWithMemoryBudget:(NSUInteger)memoryBudget;
+- (void)appendData:(NSData *)data
+     packetHandler:(NS_NOESCAPE void (^)(NetworkPacket *np))packetHandler;
+/// Drops the partially received packet, e.g. when the socket is replaced.
+- (void)reset;
+
+@end
+
 NS_ASSUME_NONNULL_END
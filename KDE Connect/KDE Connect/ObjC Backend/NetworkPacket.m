@@ -40,7 +40,166 @@
 
 #define LFDATA [NSData dataWithBytes:"\x0A" length:1]
 
+#pragma mark JSON scanning
+
+// Minimal JSON scanning, just enough to find the byte ranges of large
+// top-level body strings without decoding them.
+
+static NSUInteger NPSkipWhitespace(const uint8_t *bytes, NSUInteger i, NSUInteger length)
+{
+    while (i < length && (bytes[i] == ' ' || bytes[i] == '\t' || bytes[i] == '\r' || bytes[i] == '\n')) {
+        i++;
+    }
+    return i;
+}
+
+/// Returns the index right after the closing quote of the string starting at i.
+static NSUInteger NPSkipString(const uint8_t *bytes, NSUInteger i, NSUInteger length)
+{
+    if (i >= length || bytes[i] != '"') {
+        return NSNotFound;
+    }
+    for (i++; i < length; i++) {
+        if (bytes[i] == '\\') {
+            i++;
+        } else if (bytes[i] == '"') {
+            return i + 1;
+        }
+    }
+    return NSNotFound;
+}
+
+/// Returns the index right after the value starting at i.
+static NSUInteger NPSkipValue(const uint8_t *bytes, NSUInteger i, NSUInteger length)
+{
+    if (i >= length) {
+        return NSNotFound;
+    }
+    if (bytes[i] == '"') {
+        return NPSkipString(bytes, i, length);
+    }
+    if (bytes[i] == '{' || bytes[i] == '[') {
+        NSUInteger depth = 0;
+        while (i < length) {
+            switch (bytes[i]) {
+                case '"':
+                    i = NPSkipString(bytes, i, length);
+                    if (i == NSNotFound) {
+                        return NSNotFound;
+                    }
+                    continue;
+                case '{':
+                case '[':
+                    depth++;
+                    break;
+                case '}':
+                case ']':
+                    if (--depth == 0) {
+                        return i + 1;
+                    }
+                    break;
+            }
+            i++;
+        }
+        return NSNotFound;
+    }
+    // number, true, false, null
+    while (i < length && bytes[i] != ',' && bytes[i] != '}' && bytes[i] != ']'
+           && bytes[i] != ' ' && bytes[i] != '\t' && bytes[i] != '\r' && bytes[i] != '\n') {
+        i++;
+    }
+    return i;
+}
+
+static BOOL NPRangeEqualsKey(const uint8_t *bytes, NSRange range, const char *key)
+{
+    size_t keyLength = strlen(key);
+    return range.length == keyLength + 2 && memcmp(bytes + range.location + 1, key, keyLength) == 0;
+}
+
+/// Collects ranges (quotes included) of top-level body strings longer than
+/// minLength, keyed by the still JSON encoded key. Bails out on malformed
+/// input, leaving the error reporting to NSJSONSerialization.
+static NSDictionary<NSData *, NSValue *> *NPFindLazyBodyValues(NSData *data, NSUInteger minLength)
+{
+    const uint8_t *bytes = data.bytes;
+    NSUInteger length = data.length;
+    NSMutableDictionary<NSData *, NSValue *> *ranges = [NSMutableDictionary dictionary];
+
+    NSUInteger i = NPSkipWhitespace(bytes, 0, length);
+    if (i >= length || bytes[i] != '{') {
+        return ranges;
+    }
+    i++;
+    while (YES) {
+        i = NPSkipWhitespace(bytes, i, length);
+        NSUInteger keyEnd = NPSkipString(bytes, i, length);
+        if (keyEnd == NSNotFound) {
+            return ranges;
+        }
+        NSRange keyRange = NSMakeRange(i, keyEnd - i);
+        i = NPSkipWhitespace(bytes, keyEnd, length);
+        if (i >= length || bytes[i] != ':') {
+            return ranges;
+        }
+        i = NPSkipWhitespace(bytes, i + 1, length);
+        if (i < length && bytes[i] == '{' && NPRangeEqualsKey(bytes, keyRange, "body")) {
+            i++;
+            while (YES) {
+                i = NPSkipWhitespace(bytes, i, length);
+                NSUInteger bodyKeyEnd = NPSkipString(bytes, i, length);
+                if (bodyKeyEnd == NSNotFound) {
+                    break;
+                }
+                NSRange bodyKeyRange = NSMakeRange(i, bodyKeyEnd - i);
+                i = NPSkipWhitespace(bytes, bodyKeyEnd, length);
+                if (i >= length || bytes[i] != ':') {
+                    return ranges;
+                }
+                i = NPSkipWhitespace(bytes, i + 1, length);
+                NSUInteger valueEnd = NPSkipValue(bytes, i, length);
+                if (valueEnd == NSNotFound) {
+                    return ranges;
+                }
+                if (bytes[i] == '"' && valueEnd - i > minLength) {
+                    ranges[[data subdataWithRange:bodyKeyRange]] = [NSValue valueWithRange:NSMakeRange(i, valueEnd - i)];
+                }
+                i = NPSkipWhitespace(bytes, valueEnd, length);
+                if (i >= length || bytes[i] != ',') {
+                    break;
+                }
+                i++;
+            }
+            // skip the closing brace of body
+            i = NPSkipWhitespace(bytes, i, length);
+            if (i >= length || bytes[i] != '}') {
+                return ranges;
+            }
+            i++;
+        } else {
+            i = NPSkipValue(bytes, i, length);
+            if (i == NSNotFound) {
+                return ranges;
+            }
+        }
+        i = NPSkipWhitespace(bytes, i, length);
+        if (i >= length || bytes[i] != ',') {
+            return ranges;
+        }
+        i++;
+    }
+}
+
 #pragma mark Implementation
+@interface NetworkPacket ()
+{
+    // Raw packet backing the values in _lazyBodyRanges, maybe memory-mapped.
+    // Lock using self, _Body materializes them and drops the backing data
+    NSData *_lazyBodyData;
+    NSMutableDictionary<NSString *, NSValue *> *_lazyBodyRanges;
+}
+@end
+
 @implementation NetworkPacket
 
 - (NetworkPacket*) initWithType:(NetworkPacketType)type
@@ -108,8 +267,10 @@
     //  If key does not start with “@”, invokes `objectForKey:`.
     //  If key does start with “@”, strips the “@” and
     //      invokes [super valueForKey:] with the rest of the key.
-    if ([self._Body valueForKey:key]!=nil) {
-        return true;
+    @synchronized (self) {
+        if ([_Body valueForKey:key]!=nil || _lazyBodyRanges[key] != nil) {
+            return true;
+        }
     }
     return false;
 };
@@ -131,7 +292,10 @@
 }
 
 - (void)setObject:(id)value forKey:(NSString *)key{
-    [_Body setObject:value forKey:key];
+    @synchronized (self) {
+        [_lazyBodyRanges removeObjectForKey:key];
+        [_Body setObject:value forKey:key];
+    }
 }
 
 - (BOOL)boolForKey:(NSString*)key {
@@ -150,11 +314,70 @@
 }
 
 - (id)objectForKey:(NSString *)key{
-    return [_Body objectForKey:key];
+    id value;
+    NSData *data;
+    NSValue *range;
+    @synchronized (self) {
+        value = [_Body objectForKey:key];
+        range = _lazyBodyRanges[key];
+        // Keeps the bytes alive even if _Body drops them while we decode
+        data = _lazyBodyData;
+    }
+    if (value == nil && range != nil) {
+        // Intentionally not cached, so the decoded copy lives only as long as the caller needs it
+        value = [self decodeLazyBodyValueForKey:key inData:data range:range.rangeValue];
+    }
+    return value;
 }
 
 - (NSString*)stringForKey:(NSString *)key{
-    return [_Body objectForKey:key];
+    return [self objectForKey:key];
+}
+
+#pragma mark Lazy body values
+/// `data` must stay alive until this returns, the value is parsed in place
+- (nullable id)decodeLazyBodyValueForKey:(NSString *)key inData:(NSData *)data range:(NSRange)range
+{
+    NSData *raw = [NSData dataWithBytesNoCopy:(void *)((const uint8_t *)data.bytes + range.location)
+                                       length:range.length
+                                 freeWhenDone:NO];
+    NSError *err = nil;
+    id value = [NSJSONSerialization JSONObjectWithData:raw options:NSJSONReadingFragmentsAllowed error:&err];
+    if (err) {
+        os_log_t logger = os_log_create([NSString kdeConnectOSLogSubsystem].UTF8String,
+                                        NSStringFromClass([self class]).UTF8String);
+        os_log_with_type(logger, OS_LOG_TYPE_FAULT, "NP lazy value for %{public}@ unserialize error: %{public}@", key, err);
+    }
+    return value;
+}
+
+- (NSMutableDictionary<NSString *, id> *)_Body
+{
+    // Callers may enumerate or mutate the dictionary, decode everything
+    @synchronized (self) {
+        if (_lazyBodyRanges.count > 0) {
+            for (NSString *key in _lazyBodyRanges) {
+                id value = [self decodeLazyBodyValueForKey:key
+                                                    inData:_lazyBodyData
+                                                     range:_lazyBodyRanges[key].rangeValue];
+                if (value) {
+                    [_Body setObject:value forKey:key];
+                }
+            }
+        }
+        _lazyBodyRanges = nil;
+        _lazyBodyData = nil;
+        return _Body;
+    }
+}
+
+- (void)set_Body:(NSMutableDictionary<NSString *, id> *)body
+{
+    @synchronized (self) {
+        _lazyBodyRanges = nil;
+        _lazyBodyData = nil;
+        _Body = body;
+    }
 }
 
 #pragma mark Serialize
@@ -186,11 +409,49 @@
 {
     NetworkPacket* np=[[NetworkPacket alloc] init];
     NSError* err=nil;
-    NSDictionary* info=[NSJSONSerialization JSONObjectWithData:data options:NSJSONReadingMutableContainers error:&err];
 
-    // FIXME: add missing null check
+    // Replace large body strings with null so they don't get decoded, keep their ranges instead
+    NSDictionary<NSData *, NSValue *> *lazyRanges = nil;
+    NSData *jsonData = data;
+    if (data.length > LAZY_BODY_VALUE_SIZE) {
+        lazyRanges = NPFindLazyBodyValues(data, LAZY_BODY_VALUE_SIZE);
+    }
+    if (lazyRanges.count > 0) {
+        NSArray<NSValue *> *sortedRanges = [[lazyRanges allValues] sortedArrayUsingComparator:^NSComparisonResult(NSValue *a, NSValue *b) {
+            return [@(a.rangeValue.location) compare:@(b.rangeValue.location)];
+        }];
+        NSMutableData *stripped = [NSMutableData dataWithCapacity:LAZY_BODY_VALUE_SIZE];
+        NSUInteger location = 0;
+        for (NSValue *value in sortedRanges) {
+            NSRange range = value.rangeValue;
+            [stripped appendBytes:(const uint8_t *)data.bytes + location length:range.location - location];
+            [stripped appendBytes:"null" length:4];
+            location = NSMaxRange(range);
+        }
+        [stripped appendBytes:(const uint8_t *)data.bytes + location length:data.length - location];
+        jsonData = stripped;
+    }
+
+    // Only the body needs to be mutable, no need for NSJSONReadingMutableContainers deep copies
+    NSDictionary* info=[NSJSONSerialization JSONObjectWithData:jsonData options:0 error:&err];
+    if (err || ![info isKindOfClass:[NSDictionary class]]) {
+        return nil;
+    }
+
     np.type = [info valueForKey:@"type"];
-    [np set_Body:[info valueForKey:@"body"]];
+    NSDictionary *body = [info valueForKey:@"body"];
+    [np set_Body:[body isKindOfClass:[NSDictionary class]] ? [body mutableCopy] : [NSMutableDictionary dictionary]];
+    if (lazyRanges.count > 0) {
+        np->_lazyBodyData = data;
+        np->_lazyBodyRanges = [NSMutableDictionary dictionaryWithCapacity:lazyRanges.count];
+        [lazyRanges enumerateKeysAndObjectsUsingBlock:^(NSData *encodedKey, NSValue *range, BOOL *stop) {
+            NSString *key = [NSJSONSerialization JSONObjectWithData:encodedKey options:NSJSONReadingFragmentsAllowed error:nil];
+            if ([key isKindOfClass:[NSString class]]) {
+                [np->_Body removeObjectForKey:key];
+                np->_lazyBodyRanges[key] = range;
+            }
+        }];
+    }
     [np set_PayloadSize:[[info valueForKey:@"payloadSize"]longValue]];
     [np setPayloadTransferInfo:[info valueForKey:@"payloadTransferInfo"]];
     
@@ -203,11 +464,174 @@
         [np set_PayloadSize:size];
     }
     [np setPayloadTransferInfo:[info valueForKey:@"payloadTransferInfo"]];
-    
-    // FIXME: error check too late
-    if (err) {
+    return np;
+}
+
+@end
+
+#pragma mark - Stream Parser
+
+@implementation NetworkPacketStreamParser
+{
+    NSUInteger _memoryBudget;
+    // Bytes of the current packet, either in _buffer or in _spillHandle
+    NSUInteger _packetLength;
+    NSMutableData *_buffer;
+    NSURL *_spillURL;
+    NSFileHandle *_spillHandle;
+    // Set when the current packet is over MAX_PACKET_SIZE, skip until next LF
+    BOOL _discarding;
+    os_log_t logger;
+}
+
+- (instancetype)initWithMemoryBudget:(NSUInteger)memoryBudget
+{
+    if (self = [super init]) {
+        logger = os_log_create([NSString kdeConnectOSLogSubsystem].UTF8String,
+                               NSStringFromClass([self class]).UTF8String);
+        _memoryBudget = memoryBudget;
+        _buffer = [NSMutableData data];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [self removeSpillFile];
+}
+
+- (void)appendData:(NSData *)data packetHandler:(NS_NOESCAPE void (^)(NetworkPacket *np))packetHandler
+{
+    const uint8_t *bytes = data.bytes;
+    NSUInteger length = data.length;
+    NSUInteger start = 0;
+    while (start < length) {
+        const uint8_t *lf = memchr(bytes + start, '\n', length - start);
+        NSUInteger end = lf ? (NSUInteger)(lf - bytes) : length;
+        [self appendBytes:bytes + start length:end - start];
+        if (!lf) {
+            break;
+        }
+        NetworkPacket *np = [self finishPacket];
+        if (np) {
+            packetHandler(np);
+        }
+        start = end + 1;
+    }
+}
+
+- (void)reset
+{
+    [self removeSpillFile];
+    _buffer = [NSMutableData data];
+    _packetLength = 0;
+    _discarding = NO;
+}
+
+- (void)appendBytes:(const uint8_t *)bytes length:(NSUInteger)length
+{
+    if (_discarding || length == 0) {
+        return;
+    }
+    _packetLength += length;
+    if (_packetLength > MAX_PACKET_SIZE) {
+        os_log_with_type(logger, OS_LOG_TYPE_ERROR,
+                         "Dropping packet larger than %d bytes", MAX_PACKET_SIZE);
+        [self reset];
+        _discarding = YES;
+        return;
+    }
+    if (_spillHandle == nil && _packetLength > _memoryBudget && ![self spillToDisk]) {
+        [self reset];
+        _discarding = YES;
+        return;
+    }
+    if (_spillHandle) {
+        NSError *error = nil;
+        [_spillHandle writeData:[NSData dataWithBytesNoCopy:(void *)bytes length:length freeWhenDone:NO]
+                          error:&error];
+        if (error) {
+            os_log_with_type(logger, OS_LOG_TYPE_FAULT,
+                             "Failed to spill packet to disk due to %{public}@", error);
+            [self reset];
+            _discarding = YES;
+        }
+    } else {
+        [_buffer appendBytes:bytes length:length];
+    }
+}
+
+- (BOOL)spillToDisk
+{
+    NSString *filename = [[[NSProcessInfo processInfo] globallyUniqueString]
+                          stringByAppendingPathExtension:@"kdeconnect-packet"];
+    _spillURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:filename]];
+    // Packet bodies are clipboard contents, messages and the like. Keep them unreadable
+    // while locked, except for the handle we already hold for a receive in progress.
+    NSDictionary *attributes = @{NSFileProtectionKey: NSFileProtectionCompleteUnlessOpen};
+    NSError *error = nil;
+    if (![[NSFileManager defaultManager] createFileAtPath:_spillURL.path contents:_buffer attributes:attributes]
+        || !(_spillHandle = [NSFileHandle fileHandleForWritingToURL:_spillURL error:&error])) {
+        os_log_with_type(logger, OS_LOG_TYPE_FAULT,
+                         "Failed to create spill file for oversized packet: %{public}@", error);
+        return NO;
+    }
+    [_spillHandle seekToEndOfFile];
+    os_log_with_type(logger, OS_LOG_TYPE_INFO,
+                     "Packet exceeds memory budget of %lu bytes, spilling to disk",
+                     (unsigned long)_memoryBudget);
+    _buffer = [NSMutableData data];
+    return YES;
+}
+
+- (void)removeSpillFile
+{
+    if (_spillHandle) {
+        [_spillHandle closeAndReturnError:nil];
+        _spillHandle = nil;
+    }
+    if (_spillURL) {
+        [[NSFileManager defaultManager] removeItemAtURL:_spillURL error:nil];
+        _spillURL = nil;
+    }
+}
+
+- (nullable NetworkPacket *)finishPacket
+{
+    if (_discarding) {
+        _discarding = NO;
+        _packetLength = 0;
         return nil;
     }
+    if (_packetLength == 0) {
+        return nil;
+    }
+    NSData *packetData;
+    if (_spillHandle) {
+        [_spillHandle closeAndReturnError:nil];
+        _spillHandle = nil;
+        NSError *error = nil;
+        // Mapped pages stay valid after the file is unlinked
+        packetData = [NSData dataWithContentsOfURL:_spillURL options:NSDataReadingMappedAlways error:&error];
+        [self removeSpillFile];
+        if (error) {
+            os_log_with_type(logger, OS_LOG_TYPE_FAULT,
+                             "Failed to map spilled packet due to %{public}@", error);
+        }
+    } else {
+        packetData = _buffer;
+        _buffer = [NSMutableData data];
+    }
+    _packetLength = 0;
+    if (packetData == nil) {
+        return nil;
+    }
+    NetworkPacket *np = [NetworkPacket unserialize:packetData];
+    if (np == nil) {
+        os_log_with_type(logger, OS_LOG_TYPE_ERROR,
+                         "Failed to unserialize packet of %lu bytes",
+                         (unsigned long)packetData.length);
+    }
     return np;
 }
 
@@ -41,6 +41,12 @@
 
 - (BaseLink *)init:(DeviceInfo *)deviceInfo;
 - (BOOL) sendPacket:(NetworkPacket*)np tag:(long)tag;
+/// Sends `data`, the already serialized `np`, so it can be shared between links.
+/// Defaults to sendPacket:tag:, for links that don't deal with bytes.
+- (BOOL) sendSerializedPacket:(NSData*)data ofPacket:(NetworkPacket*)np tag:(long)tag;
+/// Hands over packets accepted by this link but not written out yet,
+/// e.g. to resend them over another link after this one went down.
+- (void) drainUnsentPackets:(void (NS_NOESCAPE ^)(NetworkPacket* np, long tag))handler;
 - (void) disconnect;
 
 @end;
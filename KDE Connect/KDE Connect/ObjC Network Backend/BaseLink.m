@@ -46,6 +46,16 @@
     return NO;
 }
 
+- (BOOL) sendSerializedPacket:(NSData*)data ofPacket:(NetworkPacket*)np tag:(long)tag
+{
+    return [self sendPacket:np tag:tag];
+}
+
+- (void) drainUnsentPackets:(void (NS_NOESCAPE ^)(NetworkPacket* np, long tag))handler
+{
+    // nothing is queued
+}
+
 - (void) disconnect
 {
     // do nothing
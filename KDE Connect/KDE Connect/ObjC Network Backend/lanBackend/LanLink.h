@@ -34,9 +34,17 @@
 
 @interface LanLink : BaseLink <GCDAsyncSocketDelegate>
 
+/// Heartbeat RTT estimates, 0 until the first sample
+@property(atomic, readonly) NSTimeInterval smoothedRTT;
+@property(atomic, readonly) NSTimeInterval rttVariance;
+/// Whether the link went down because the peer stopped responding
+@property(atomic, readonly) BOOL peerLost;
+
 - (LanLink *)init:(GCDAsyncSocket*)socket
        deviceInfo:(DeviceInfo*)deviceInfo;
 - (BOOL) sendPacket:(NetworkPacket *)np tag:(long)tag;
+- (BOOL) sendSerializedPacket:(NSData *)data ofPacket:(NetworkPacket *)np tag:(long)tag;
+- (void) drainUnsentPackets:(void (NS_NOESCAPE ^)(NetworkPacket *np, long tag))handler;
 - (void) setSocket:(GCDAsyncSocket *)newSocket;
 - (void) disconnect;
 @end
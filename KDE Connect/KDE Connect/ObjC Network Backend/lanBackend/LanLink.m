@@ -31,6 +31,10 @@
 #import "LanLinkProvider.h"
 #import "KDE_Connect-Swift.h"
 
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <netinet/tcp.h>
+
 @import os.log;
 
 #define PAYLOAD_PORT 1739
@@ -38,16 +42,45 @@
 // NSUInteger defaultReadLength = (1024 * 32) from CocoaAsyncSocket
 #define CHUNK_SIZE (1024 * 32)
 
+// The heartbeat are TCP keepalive probes, which the peer's TCP stack answers
+// without any protocol support. Idle time before probing an idle link:
+#define HEARTBEAT_INTERVAL 5 //s
+#define HEARTBEAT_MAX_MISSED 3
+// Bounds for the dead-link budget, HEARTBEAT_MAX_MISSED backed off retransmission
+// timeouts. LAN RTOs are a few hundred ms, so the floor keeps Wi-Fi power saving
+// from looking like a dead peer.
+#define HEARTBEAT_MIN_TIMEOUT_MS 2000
+#define HEARTBEAT_MAX_TIMEOUT_MS 30000
+// The watchdog looks a few times per budget, but not more often than this
+#define HEARTBEAT_MIN_TICK_MS 250
+// Bounds for the keepalive probe interval, the kernel takes whole seconds
+#define HEARTBEAT_MIN_PROBE_INTERVAL 1 //s
+#define HEARTBEAT_MAX_PROBE_INTERVAL 10 //s
+
 @interface LanLink()
 {
     uint16_t _payloadPort;
+    // Payload server and heartbeat only, each transfer gets its own queue
     dispatch_queue_t _socketQueue;
+    NetworkPacketStreamParser *_packetParser;
     os_log_t logger;
+    // Heartbeat state below is only touched on _socketQueue
+
+    dispatch_source_t _heartbeatTimer;
+    GCDAsyncSocket *_heartbeatSocket;
+    uint32_t _deadLinkTimeoutMs;
+    uint32_t _heartbeatTickMs;
+    // For the watchdog in case the kernel doesn't drop the connection by itself
+    NSDate *_lastProgressDate;
+    uint64_t _lastRxBytes;
+    uint32_t _lastSendBufferBytes;
 }
 
 @property(nonatomic) GCDAsyncSocket* _socket;
 @property(nonatomic) NetworkPacket* _pendingPairNP;
 
+// Transfers run concurrently, only hold these locks to update the lists,
+// never while doing file I/O or notifying the delegate.
 // Lock using _socketsForIncomingPayload
 @property(nonatomic) NSMutableArray<GCDAsyncSocket *> *socketsForIncomingPayload;
 
@@ -58,6 +91,15 @@
 @property(nonatomic) SecIdentityRef _identity;
 @property(nonatomic) GCDAsyncSocket* _fileServerSocket;
 
+// Written but not yet reported by didWriteDataWithTag, in order.
+// Lock using _packetsInFlight
+@property(nonatomic) NSMutableArray<NetworkPacket *> *packetsInFlight;
+@property(nonatomic) NSMutableArray<NSNumber *> *tagsInFlight;
+
+@property(atomic, readwrite) NSTimeInterval smoothedRTT;
+@property(atomic, readwrite) NSTimeInterval rttVariance;
+@property(atomic, readwrite) BOOL peerLost;
+
 @end
 
 @implementation LanLink
@@ -75,6 +117,10 @@
         logger = os_log_create([NSString kdeConnectOSLogSubsystem].UTF8String,
                                NSStringFromClass([self class]).UTF8String);
         _pendingPairNP=nil;
+        _packetParser = [[NetworkPacketStreamParser alloc] initWithMemoryBudget:PACKET_MEMORY_BUDGET];
+        _packetsInFlight = [NSMutableArray arrayWithCapacity:1];
+        _tagsInFlight = [NSMutableArray arrayWithCapacity:1];
+        _socketQueue=dispatch_queue_create("com.kde.org.kdeconnect.payload_socketQueue", NULL);
         [self setSocket:socket];
         
         _socketsForOutgoingPayload = [NSMutableArray arrayWithCapacity:1];
@@ -83,13 +129,18 @@
         _socketsForIncomingPayload = [NSMutableArray arrayWithCapacity:1];
         
         _payloadPort=PAYLOAD_PORT;
-        _socketQueue=dispatch_queue_create("com.kde.org.kdeconnect.payload_socketQueue", NULL);
     
         [self loadSecIdentity];
     }
     return self;
 }
 
+/// Serial queue for a single payload transfer, so transfers don't wait on each other.
+- (dispatch_queue_t)newTransferQueue
+{
+    return dispatch_queue_create("com.kde.org.kdeconnect.payload_transferQueue", DISPATCH_QUEUE_SERIAL);
+}
+
 - (os_log_type_t)debugLogLevel {
     if ([KdeConnectSettings shared].isDebuggingNetworkPacket) {
         return OS_LOG_TYPE_INFO;
@@ -176,28 +227,101 @@
     }
     
     NSData* data=[np serialize];
-    _socket.userData = np;
+    [self trackPacketInFlight:np tag:tag];
     [_socket writeData:data withTimeout:-1 tag:tag];
     os_log_with_type(logger, self.debugLogLevel, "%{public}@", [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding]);
     
     return YES;
 }
 
+- (BOOL) sendSerializedPacket:(NSData *)data ofPacket:(NetworkPacket *)np tag:(long)tag
+{
+    // Payload transfers put this link's port in the packet, can't share the bytes
+    if (np.payloadPath != nil) {
+        return [self sendPacket:np tag:tag];
+    }
+    os_log_with_type(logger, self.debugLogLevel, "llink send serialized packet");
+    if (![_socket isConnected]) {
+        os_log_with_type(logger, OS_LOG_TYPE_INFO, "LanLink: Device:%@ disconnected", [self _deviceInfo].id);
+        return NO;
+    }
+    // GCDAsyncSocket retains `data` without copying, so every link writes the same buffer
+    [self trackPacketInFlight:np tag:tag];
+    [_socket writeData:data withTimeout:-1 tag:tag];
+    return YES;
+}
+
+- (void)trackPacketInFlight:(NetworkPacket *)np tag:(long)tag
+{
+    @synchronized (_packetsInFlight) {
+        [_packetsInFlight addObject:np];
+        [_tagsInFlight addObject:[NSNumber numberWithLong:tag]];
+    }
+}
+
+- (void) drainUnsentPackets:(void (NS_NOESCAPE ^)(NetworkPacket *np, long tag))handler
+{
+    NSArray<NetworkPacket *> *packets;
+    NSArray<NSNumber *> *tags;
+    @synchronized (_packetsInFlight) {
+        packets = [_packetsInFlight copy];
+        tags = [_tagsInFlight copy];
+        [_packetsInFlight removeAllObjects];
+        [_tagsInFlight removeAllObjects];
+    }
+    for (NSUInteger i = 0; i < packets.count; i++) {
+        handler(packets[i], tags[i].longValue);
+    }
+}
+
 - (void)setSocket:(GCDAsyncSocket *)newSocket {
     if (_socket) {
         _socket.delegate = nil;
         [_socket disconnect];
+        // The peer can't fetch payloads offered over the old socket anymore,
+        // the ones never written are offered again below
+        [self failPendingOutgoingItemsWithError:nil];
     }
     _socket = newSocket;
     [_socket setDelegate:self];
+    // Whatever was left of a packet belongs to the old socket
+    [_packetParser reset];
+    NSMutableArray<NetworkPacket *> *unsentPackets = [NSMutableArray array];
+    NSMutableArray<NSNumber *> *unsentTags = [NSMutableArray array];
+    [self drainUnsentPackets:^(NetworkPacket *np, long tag) {
+        [unsentPackets addObject:np];
+        [unsentTags addObject:[NSNumber numberWithLong:tag]];
+    }];
+    self.peerLost = NO;
     os_log_with_type(logger, OS_LOG_TYPE_INFO,
                      "new lan link socket for device:%{mask.hash}@ configured",
                      [self _deviceInfo].id);
-    [_socket readDataToData:[GCDAsyncSocket LFData] withTimeout:-1 maxLength:MAX_PACKET_SIZE tag:PACKET_TAG_NORMAL];
+    [self readPacketData];
+    [self startHeartbeat];
+    // Resend what the old socket accepted but never wrote
+    for (NSUInteger i = 0; i < unsentPackets.count; i++) {
+        NetworkPacket *np = unsentPackets[i];
+        long tag = unsentTags[i].longValue;
+        // sendPacket reports its own payload errors, only the socket dropping again is silent
+        if (![self sendPacket:np tag:tag] && ![_socket isConnected]) {
+            [self.linkDelegate onPacket:np
+                      sendWithPacketTag:tag
+                         failedWithError:[NSError errorWithDomain:NSPOSIXErrorDomain
+                                                             code:ENOTCONN
+                                                         userInfo:nil]];
+        }
+    }
+}
+
+// Read in chunks rather than up to LF, so GCDAsyncSocket doesn't buffer
+// a whole (up to MAX_PACKET_SIZE) packet in memory for us.
+- (void)readPacketData {
+    [_socket readDataWithTimeout:-1 buffer:nil bufferOffset:0 maxLength:CHUNK_SIZE tag:PACKET_TAG_NORMAL];
 }
 
 - (void) disconnect
 {
+    [self stopHeartbeat];
     if ([_socket isConnected]) {
         [_socket disconnect];
     }
@@ -229,12 +353,19 @@
          (__bridge CFArrayRef) myCerts, (id)kCFStreamSSLCertificates,
     nil];
 
-    [newSocket startTLS: tlsSettings];
     @synchronized (_socketsForOutgoingPayload) {
+        if (_pendingOutgoingItems.count == 0) {
+            os_log_with_type(logger, OS_LOG_TYPE_ERROR, "Payload connection without pending item, ignoring");
+            [newSocket disconnect];
+            return;
+        }
         newSocket.userData = _pendingOutgoingItems.firstObject;
         [_pendingOutgoingItems removeObjectAtIndex:0];
         [_socketsForOutgoingPayload insertObject:newSocket atIndex:0];
     }
+    // Accepted sockets inherit _socketQueue, move the transfer off it
+    [newSocket setDelegateQueue:[self newTransferQueue]];
+    [newSocket startTLS: tlsSettings];
     os_log_with_type(logger, self.debugLogLevel, "Start Server TLS to send file");
 }
 
@@ -285,12 +416,12 @@
         return;
     }
     
-    os_log_with_type(logger, self.debugLogLevel, "llink did read data");
-    // BUG even if we read with a separator LFData, it's still possible to receive several data packet together. So we split the string and retrieve the packet
-    [_socket readDataToData:[GCDAsyncSocket LFData] withTimeout:-1 maxLength:MAX_PACKET_SIZE tag:PACKET_TAG_NORMAL];
-    NSString * jsonStr=[[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
-    os_log_with_type(logger, OS_LOG_TYPE_INFO, "Received: %{public}@", jsonStr);
-    [self readThroughLatestPackets:sock :jsonStr];
+    os_log_with_type(logger, self.debugLogLevel, "llink did read %lu bytes", (unsigned long)data.length);
+    [self readPacketData];
+    // A chunk may end mid-packet or contain several packets, the parser takes care of both
+    [_packetParser appendData:data packetHandler:^(NetworkPacket *np) {
+        [self onPacketParsed:np fromSocket:sock];
+    }];
 }
 
 /**
@@ -304,7 +435,18 @@
         [self sendPayloadWithSocket:sock];
         return;
     }
-    [self.linkDelegate onPacket:_socket.userData sentWithPacketTag:tag];
+    NetworkPacket *np = nil;
+    @synchronized (_packetsInFlight) {
+        // Writes complete in order
+        if (sock == _socket && _packetsInFlight.count > 0) {
+            np = _packetsInFlight.firstObject;
+            [_packetsInFlight removeObjectAtIndex:0];
+            [_tagsInFlight removeObjectAtIndex:0];
+        }
+    }
+    if (np) {
+        [self.linkDelegate onPacket:np sentWithPacketTag:tag];
+    }
 }
 
 /**
@@ -366,38 +508,52 @@
  **/
 - (void)socketDidDisconnect:(GCDAsyncSocket *)sock withError:(NSError *)err
 {
+    // Callbacks for the same payload socket are serialized on its transfer queue,
+    // so membership can't change between the check and the handling below
+    BOOL isReceivingPayload;
     @synchronized (_socketsForIncomingPayload) {
-        if ([_socketsForIncomingPayload containsObject:sock]) {
-            os_log_with_type(logger, OS_LOG_TYPE_INFO,
-                             "llink payload receiving socket disconnected with error: %{public}@",
-                             err);
-            KDEFileTransferItem *item = (KDEFileTransferItem *)sock.userData;
-            if (item.totalBytes == nil
-                && err.domain == GCDAsyncSocketErrorDomain
-                && err.code == GCDAsyncSocketClosedError) {
-                os_log_with_type(logger, OS_LOG_TYPE_ERROR,
-                                 "unknown length payload receiving ended with %lu bytes in buffer",
-                                 item.buffer.length);
-                if (item.buffer.length > 0) {
-                    os_log_with_type(logger, OS_LOG_TYPE_INFO,
-                                     "appending remaining bytes in buffer to file handle");
-                    [self writeReceivedChunk:item.buffer for:sock];
-                }
-                [self attachAndProcessPayload:sock];
-            } else {
-                [self removeIncomingPayloadReceivingSocket:sock
-                                       deleteTemporaryFile:YES];
-                [self.linkDelegate onReceivingPayload:item failedWithError:err];
+        isReceivingPayload = [_socketsForIncomingPayload containsObject:sock];
+    }
+    if (isReceivingPayload) {
+        os_log_with_type(logger, OS_LOG_TYPE_INFO,
+                         "llink payload receiving socket disconnected with error: %{public}@",
+                         err);
+        KDEFileTransferItem *item = (KDEFileTransferItem *)sock.userData;
+        if (item.totalBytes == nil
+            && err.domain == GCDAsyncSocketErrorDomain
+            && err.code == GCDAsyncSocketClosedError) {
+            os_log_with_type(logger, OS_LOG_TYPE_ERROR,
+                             "unknown length payload receiving ended with %lu bytes in buffer",
+                             item.buffer.length);
+            if (item.buffer.length > 0) {
+                os_log_with_type(logger, OS_LOG_TYPE_INFO,
+                                 "appending remaining bytes in buffer to file handle");
+                [self writeReceivedChunk:item.buffer for:sock];
             }
+            [self attachAndProcessPayload:sock];
+        } else {
+            [self removeIncomingPayloadReceivingSocket:sock
+                                   deleteTemporaryFile:YES];
+            [self.linkDelegate onReceivingPayload:item failedWithError:err];
         }
     }
+    BOOL isSendingPayload;
     @synchronized (_socketsForOutgoingPayload) {
-        if ([_socketsForOutgoingPayload containsObject:sock]) {
-            os_log_with_type(logger, OS_LOG_TYPE_INFO,
-                             "llink payload sending socket disconnected with error: %{public}@",
-                             err);
-            [self removeOutgoingPayloadSendingSocket:sock error:err];
+        isSendingPayload = [_socketsForOutgoingPayload containsObject:sock];
+    }
+    if (isSendingPayload) {
+        os_log_with_type(logger, OS_LOG_TYPE_INFO,
+                         "llink payload sending socket disconnected with error: %{public}@",
+                         err);
+        [self removeOutgoingPayloadSendingSocket:sock error:err];
+    }
+    if (sock == _socket) {
+        [self stopHeartbeat];
+        if (err && !(err.domain == GCDAsyncSocketErrorDomain && err.code == GCDAsyncSocketClosedError)) {
+            // e.g. ETIMEDOUT from missed heartbeats, as opposed to the peer closing the link
+            self.peerLost = YES;
         }
+        [self failPendingOutgoingItemsWithError:err];
     }
     if (self.linkDelegate && (sock == _socket)) {
         os_log_with_type(logger, OS_LOG_TYPE_INFO, "llink socket did disconnect with error: %{public}@", err);
@@ -409,18 +565,22 @@
 {
     os_log_with_type(logger, self.debugLogLevel, "Connection is secure");
     
+    BOOL isSendingPayload;
     @synchronized(_socketsForOutgoingPayload){
-        if ([_socketsForOutgoingPayload containsObject:sock]) {
-            // I'm the server
-            [self sendPayloadWithSocket: sock];
-        }
+        isSendingPayload = [_socketsForOutgoingPayload containsObject:sock];
+    }
+    if (isSendingPayload) {
+        // I'm the server
+        [self sendPayloadWithSocket: sock];
     }
 
+    BOOL isReceivingPayload;
     @synchronized (_socketsForIncomingPayload) {
-        if ([_socketsForIncomingPayload containsObject:sock]) {
-            // I'm the client
-            [self receivePayloadWithSocket: sock];
-        }
+        isReceivingPayload = [_socketsForIncomingPayload containsObject:sock];
+    }
+    if (isReceivingPayload) {
+        // I'm the client
+        [self receivePayloadWithSocket: sock];
     }
 }
 
@@ -445,6 +605,158 @@
     }
 }
 
+#pragma mark - Heartbeat
+
+- (void)startHeartbeat
+{
+    GCDAsyncSocket *socket = _socket;
+    dispatch_async(_socketQueue, ^{
+        [self cancelHeartbeatTimer];
+        self->_heartbeatSocket = socket;
+        self.smoothedRTT = 0;
+        self.rttVariance = 0;
+        // Conservative until the first sample, which the handshake already provided
+        self->_deadLinkTimeoutMs = HEARTBEAT_MAX_TIMEOUT_MS;
+        self->_heartbeatTickMs = HEARTBEAT_MIN_TICK_MS;
+        self->_lastProgressDate = [NSDate date];
+        self->_lastRxBytes = 0;
+        self->_lastSendBufferBytes = 0;
+        [self applyHeartbeatOptions];
+
+        dispatch_source_t timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self->_socketQueue);
+        __weak LanLink *weakSelf = self;
+        dispatch_source_set_event_handler(timer, ^{
+            [weakSelf heartbeat];
+        });
+        self->_heartbeatTimer = timer;
+        [self scheduleHeartbeatTimer];
+        dispatch_resume(timer);
+    });
+}
+
+/// Must be called on _socketQueue
+- (void)scheduleHeartbeatTimer
+{
+    uint64_t tick = (uint64_t)_heartbeatTickMs * NSEC_PER_MSEC;
+    dispatch_source_set_timer(_heartbeatTimer, dispatch_time(DISPATCH_TIME_NOW, tick), tick, tick / 10);
+}
+
+- (void)stopHeartbeat
+{
+    dispatch_async(_socketQueue, ^{
+        [self cancelHeartbeatTimer];
+    });
+}
+
+/// Must be called on _socketQueue
+- (void)cancelHeartbeatTimer
+{
+    if (_heartbeatTimer) {
+        dispatch_source_cancel(_heartbeatTimer);
+        _heartbeatTimer = nil;
+    }
+    _heartbeatSocket = nil;
+}
+
+- (void)dealloc
+{
+    // Nothing else can reach the timer by now, and blocks can't retain self anymore
+    if (_heartbeatTimer) {
+        dispatch_source_cancel(_heartbeatTimer);
+    }
+}
+
+/// Lets the kernel probe an idle peer every budget / HEARTBEAT_MAX_MISSED, and give
+/// up on unacknowledged data after the budget, both rounded up to whole seconds.
+/// Either way the socket disconnects with ETIMEDOUT.
+- (void)applyHeartbeatOptions
+{
+    GCDAsyncSocket *socket = _heartbeatSocket;
+    int idle = HEARTBEAT_INTERVAL;
+    int interval = (int)((_deadLinkTimeoutMs / HEARTBEAT_MAX_MISSED + 999) / 1000);
+    interval = MAX(HEARTBEAT_MIN_PROBE_INTERVAL, MIN(HEARTBEAT_MAX_PROBE_INTERVAL, interval));
+    int count = HEARTBEAT_MAX_MISSED;
+    int dropTime = (int)((_deadLinkTimeoutMs + 999) / 1000);
+    os_log_t log = logger;
+    [socket performBlock:^{
+        int fd = [socket socketFD];
+        if (fd < 0) {
+            return;
+        }
+        int on = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) != 0
+            || setsockopt(fd, IPPROTO_TCP, TCP_KEEPALIVE, &idle, sizeof(idle)) != 0
+            || setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) != 0
+            || setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count)) != 0) {
+            os_log_with_type(log, OS_LOG_TYPE_ERROR, "Failed to configure heartbeat: %d", errno);
+        }
+#ifdef TCP_RXT_CONNDROPTIME
+        setsockopt(fd, IPPROTO_TCP, TCP_RXT_CONNDROPTIME, &dropTime, sizeof(dropTime));
+#endif
+    }];
+}
+
+- (void)heartbeat
+{
+    GCDAsyncSocket *socket = _heartbeatSocket;
+    __block struct tcp_connection_info info;
+    __block BOOL sampled = NO;
+    [socket performBlock:^{
+        int fd = [socket socketFD];
+        if (fd < 0) {
+            return;
+        }
+        socklen_t length = sizeof(info);
+        sampled = getsockopt(fd, IPPROTO_TCP, TCP_CONNECTION_INFO, &info, &length) == 0;
+    }];
+    if (!sampled) {
+        return;
+    }
+
+    // The kernel keeps smoothed RTT and variance as in RFC 6298, in ms. Keepalive ACKs
+    // don't acknowledge new data, so it only samples while data flows: on an idle link
+    // the budget keeps its last value and the keepalive probes do the detecting.
+    if (info.tcpi_srtt > 0) {
+        self.smoothedRTT = info.tcpi_srtt / 1000.0;
+        self.rttVariance = info.tcpi_rttvar / 1000.0;
+        uint64_t rto = MAX((uint64_t)info.tcpi_rto, (uint64_t)info.tcpi_srtt + 4 * (uint64_t)info.tcpi_rttvar);
+        // Each missed retransmission doubles the timeout: RTO + 2 RTO + 4 RTO...
+        uint64_t budget = rto * ((1 << HEARTBEAT_MAX_MISSED) - 1);
+        uint32_t deadLinkTimeoutMs = (uint32_t)MAX(HEARTBEAT_MIN_TIMEOUT_MS, MIN(HEARTBEAT_MAX_TIMEOUT_MS, budget));
+        if (deadLinkTimeoutMs != _deadLinkTimeoutMs) {
+            _deadLinkTimeoutMs = deadLinkTimeoutMs;
+            [self applyHeartbeatOptions];
+        }
+        uint32_t tickMs = MAX(HEARTBEAT_MIN_TICK_MS, MIN(HEARTBEAT_INTERVAL * 1000, _deadLinkTimeoutMs / HEARTBEAT_MAX_MISSED));
+        if (tickMs != _heartbeatTickMs) {
+            _heartbeatTickMs = tickMs;
+            [self scheduleHeartbeatTimer];
+        }
+    }
+
+    // Anything received, acknowledged, or nothing left to acknowledge counts as alive
+    if (info.tcpi_rxbytes != _lastRxBytes
+        || info.tcpi_snd_sbbytes < _lastSendBufferBytes
+        || info.tcpi_snd_sbbytes == 0) {
+        _lastProgressDate = [NSDate date];
+    }
+    _lastRxBytes = info.tcpi_rxbytes;
+    _lastSendBufferBytes = info.tcpi_snd_sbbytes;
+
+    NSTimeInterval silence = -[_lastProgressDate timeIntervalSinceNow];
+    os_log_with_type(logger, self.debugLogLevel,
+                     "heartbeat srtt %.1fms rttvar %.1fms, budget %ums, stalled for %.0fms",
+                     self.smoothedRTT * 1000, self.rttVariance * 1000, _deadLinkTimeoutMs, silence * 1000);
+    if (silence * 1000 > _deadLinkTimeoutMs) {
+        os_log_with_type(logger, OS_LOG_TYPE_ERROR,
+                         "LanLink: Device:%{mask.hash}@ left data unacknowledged for %.0fms, dropping link",
+                         [self _deviceInfo].id, silence * 1000);
+        self.peerLost = YES;
+        [self cancelHeartbeatTimer];
+        [socket disconnect];
+    }
+}
+
 #pragma mark - Sending Payloads for Share Plugin
 
 - (void)sendPayloadWithSocket:(GCDAsyncSocket *)sock {
@@ -470,7 +782,7 @@
     }
     dispatch_time_t t = dispatch_time(DISPATCH_TIME_NOW, 0);
     t=dispatch_time(t, PAYLOAD_SEND_DELAY*NSEC_PER_MSEC);
-    dispatch_after(t,_socketQueue, ^(void){
+    dispatch_after(t,sock.delegateQueue, ^(void){
         [sock writeData:chunk withTimeout:-1 tag:PACKET_TAG_PAYLOAD];
     });
 }
@@ -493,6 +805,37 @@
     }
 }
 
+/// Nobody can connect to fetch these payloads anymore once the control socket is gone.
+/// Packets that were never written are failed by the device when it drains this link,
+/// so only release their file handles here.
+- (void)failPendingOutgoingItemsWithError:(nullable NSError *)error {
+    NSArray<KDEFileTransferItem *> *items;
+    @synchronized (_socketsForOutgoingPayload) {
+        items = [_pendingOutgoingItems copy];
+        [_pendingOutgoingItems removeAllObjects];
+    }
+    if (items.count == 0) {
+        return;
+    }
+    if (error == nil) {
+        error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ETIMEDOUT userInfo:nil];
+    }
+    for (KDEFileTransferItem *item in items) {
+        NetworkPacket *np = item.networkPacket;
+        [item.fileHandle closeAndReturnError:nil];
+        [np.payloadPath stopAccessingSecurityScopedResource];
+        BOOL unsent;
+        @synchronized (_packetsInFlight) {
+            unsent = [_packetsInFlight indexOfObjectIdenticalTo:np] != NSNotFound;
+        }
+        if (!unsent) {
+            [self.linkDelegate onPacket:np
+                      sendWithPacketTag:PACKET_TAG_PAYLOAD
+                         failedWithError:error];
+        }
+    }
+}
+
 #pragma mark - Receiving Payloads for Share Plugin
 
 - (void)createSocketForReceivingPayloadOfNP:(NetworkPacket *)np incomingFromHost:(NSString *)host {
@@ -538,7 +881,7 @@
     np.payloadPath = [NSURL fileURLWithPath:tempPath];
     
     // Received request from remote to start new TLS connection/socket to receive file
-    GCDAsyncSocket* socket=[[GCDAsyncSocket alloc] initWithDelegate:self delegateQueue:_socketQueue];
+    GCDAsyncSocket* socket=[[GCDAsyncSocket alloc] initWithDelegate:self delegateQueue:[self newTransferQueue]];
     
     KDEFileTransferItem *item = [[KDEFileTransferItem alloc] initWithFileHandle:handle
                                                                  networkPacket:np];
@@ -603,18 +946,19 @@
 }
 
 - (void)attachAndProcessPayload:(GCDAsyncSocket *)sock {
+    BOOL exists;
     @synchronized (_socketsForIncomingPayload) {
-        BOOL exists = [_socketsForIncomingPayload containsObject:sock];
-        if (!exists) {
-            os_log_with_type(logger, OS_LOG_TYPE_FAULT,
-                             "Finished writing file but %{public}@ is already cleaned up",
-                             sock);
-            return;
-        }
-        // Ensure that temporary file can't be deleted by removing sock
-        [self removeIncomingPayloadReceivingSocket:sock
-                               deleteTemporaryFile:NO];
+        exists = [_socketsForIncomingPayload containsObject:sock];
+    }
+    if (!exists) {
+        os_log_with_type(logger, OS_LOG_TYPE_FAULT,
+                         "Finished writing file but %{public}@ is already cleaned up",
+                         sock);
+        return;
     }
+    // Ensure that temporary file can't be deleted by removing sock
+    [self removeIncomingPayloadReceivingSocket:sock
+                           deleteTemporaryFile:NO];
     KDEFileTransferItem *item = (KDEFileTransferItem *)sock.userData;
     NetworkPacket *np = item.networkPacket;
     np.type = NetworkPacketTypeShare;
@@ -643,33 +987,29 @@
 
 #pragma mark - Others
 
-- (void)readThroughLatestPackets:(GCDAsyncSocket *)sock : (NSString *) jsonStr {
-    NSArray* packetArray=[jsonStr componentsSeparatedByString:@"\n"];
-    for (NSString* dataStr in packetArray) {
-        if ([dataStr length] > 0) {
-            NetworkPacket* np=[NetworkPacket unserialize:[dataStr dataUsingEncoding:NSUTF8StringEncoding]];
-            if (self.linkDelegate && np) {
-                os_log_with_type(logger, self.debugLogLevel, "llink did read data:\n%{public}@",dataStr);
-                if ([np.type isEqualToString:NetworkPacketTypePair]) {
-                    _pendingPairNP=np;
-                }
-                // If contains transfer info, connect to remote using a new socket to transfer payload
-                // Note: Ubuntu 20.04 sends `payloadSize` and (empty) `payloadTransferInfo` for all packets.
-                if ([np payloadTransferInfo] && [[np payloadTransferInfo] objectForKey:@"port"]) {
-                    // "If that field is not set it should generate a filename."
-                    // https://invent.kde.org/network/kdeconnect-kde/-/blob/master/plugins/share/README
-                    if (![np objectForKey:@"filename"]) {
-                        [np setObject:NSLocalizedString(@"untitled",
-                                                        "Filename to use for an unnamed file")
-                               forKey:@"filename"];
-                    }
-                    [self createSocketForReceivingPayloadOfNP:np
-                                             incomingFromHost:[sock connectedHost]];
-                } else {
-                    [self.linkDelegate onPacketReceived:np];
-                }
-            }
+- (void)onPacketParsed:(NetworkPacket *)np fromSocket:(GCDAsyncSocket *)sock {
+    if (!self.linkDelegate) {
+        return;
+    }
+    // Don't log the body, large values are only decoded when plugins ask for them
+    os_log_with_type(logger, OS_LOG_TYPE_INFO, "Received: %{public}@", np.type);
+    if ([np.type isEqualToString:NetworkPacketTypePair]) {
+        _pendingPairNP=np;
+    }
+    // If contains transfer info, connect to remote using a new socket to transfer payload
+    // Note: Ubuntu 20.04 sends `payloadSize` and (empty) `payloadTransferInfo` for all packets.
+    if ([np payloadTransferInfo] && [[np payloadTransferInfo] objectForKey:@"port"]) {
+        // "If that field is not set it should generate a filename."
+        // https://invent.kde.org/network/kdeconnect-kde/-/blob/master/plugins/share/README
+        if (![np objectForKey:@"filename"]) {
+            [np setObject:NSLocalizedString(@"untitled",
+                                            "Filename to use for an unnamed file")
+                   forKey:@"filename"];
         }
+        [self createSocketForReceivingPayloadOfNP:np
+                                 incomingFromHost:[sock connectedHost]];
+    } else {
+        [self.linkDelegate onPacketReceived:np];
     }
 }
 
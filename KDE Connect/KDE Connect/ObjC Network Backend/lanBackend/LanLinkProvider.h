@@ -37,6 +37,7 @@
 
 @interface LanLinkProvider : BaseLinkProvider <LinkDelegate, GCDAsyncSocketDelegate, GCDAsyncUdpSocketDelegate>
 
+// Lock using v8delegates
 @property(nonatomic) NSMutableArray<V8IdentityExchangeDelegate *> *v8delegates;
 
 - (LanLinkProvider *)initWithDelegate:(id<LinkProviderDelegate>)linkProviderDelegate;
@@ -46,5 +47,6 @@
                        error:(NSError **)errPtr;
 
 - (void) finishAddingSocket:(GCDAsyncSocket*)sock forIdentityPacket:(NetworkPacket*)np;
+- (void) removeV8Delegate:(V8IdentityExchangeDelegate *)delegate;
 
 @end
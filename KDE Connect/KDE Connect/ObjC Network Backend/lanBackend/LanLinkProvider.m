@@ -58,7 +58,7 @@
     return self;
 }
 - (void)socket:(GCDAsyncSocket *)sock didReadData:(NSData *)data withTag:(long)tag {
-    [_lanLinkProvider.v8delegates removeObject:self];
+    [_lanLinkProvider removeV8Delegate:self];
     NetworkPacket *secureIdentity = [NetworkPacket unserialize:data];
     if (![DeviceInfo isValidIdentityPacketWithNetworkPacket:secureIdentity]) {
         return;
@@ -71,7 +71,7 @@
     [_lanLinkProvider finishAddingSocket:sock forIdentityPacket:secureIdentity];
 }
 - (void)socketDidDisconnect:(GCDAsyncSocket *)sock withError:(NSError *)err {
-    [_lanLinkProvider.v8delegates removeObject:self];
+    [_lanLinkProvider removeV8Delegate:self];
 }
 @end
 
@@ -79,13 +79,15 @@
 @interface LanLinkProvider()
 {
     uint16_t _tcpPort;
+    // Discovery and established links. Each handshake runs on its own queue
+    // and only hops onto this one to register the link.
     dispatch_queue_t socketQueue;
     os_log_t logger;
 }
 @property(nonatomic) GCDAsyncUdpSocket *udpSocket;
 @property(nonatomic) GCDAsyncSocket *tcpSocket;
+// Lock using _pendingSockets, the identity packet of each is in its userData
 @property(nonatomic) NSMutableArray<GCDAsyncSocket *> *pendingSockets;
-@property(nonatomic) NSMutableArray<NetworkPacket *> *pendingNPs;
 @property(nonatomic) SecCertificateRef _certificate;
 //@property(nonatomic) NSString * _certificateRequestPEM;
 @property(nonatomic) SecIdentityRef _identity;
@@ -111,7 +113,6 @@
         _tcpSocket=nil;
         _v8delegates = [NSMutableArray arrayWithCapacity:1];
         _pendingSockets=[NSMutableArray arrayWithCapacity:1];
-        _pendingNPs = [NSMutableArray arrayWithCapacity:1];
         self.connectedLinks = [NSMutableDictionary dictionaryWithCapacity:1];
         socketQueue=dispatch_queue_create("com.kde.org.kdeconnect.socketqueue", NULL);
 
@@ -124,6 +125,19 @@
     return self;
 }
 
+/// Serial queue for a single handshake, so TLS setups don't wait on each other.
+- (dispatch_queue_t)newHandshakeQueue
+{
+    return dispatch_queue_create("com.kde.org.kdeconnect.handshakeQueue", DISPATCH_QUEUE_SERIAL);
+}
+
+- (void)removeV8Delegate:(V8IdentityExchangeDelegate *)delegate
+{
+    @synchronized (_v8delegates) {
+        [_v8delegates removeObject:delegate];
+    }
+}
+
 - (os_log_type_t)debugLogLevel {
     KdeConnectSettings *settings = [KdeConnectSettings shared];
     if (settings.isDebuggingDiscovery || settings.isDebuggingNetworkPacket) {
@@ -254,13 +268,19 @@
                 [socket disconnect];
             }
             [_pendingSockets removeAllObjects];
-            [_pendingNPs removeAllObjects];
         }
 
-        for (BaseLink *link in [self.connectedLinks allValues]) {
+        NSArray<BaseLink *> *links;
+        @synchronized (self.connectedLinks) {
+            links = [self.connectedLinks allValues];
+        }
+        // disconnect calls back into onLinkDestroyed, don't hold the lock
+        for (BaseLink *link in links) {
             [link disconnect];
         }
-        [self.connectedLinks removeAllObjects];
+        @synchronized (self.connectedLinks) {
+            [self.connectedLinks removeAllObjects];
+        }
 
         _udpSocket = nil;
         _tcpSocket = nil;
@@ -293,8 +313,17 @@
 - (void) onLinkDestroyed:(BaseLink*)link
 {
     os_log_with_type(logger, self.debugLogLevel, "lp on linkdestroyed");
-    if (link == self.connectedLinks[[link _deviceInfo].id]) {
-        [self.connectedLinks removeObjectForKey:[link _deviceInfo].id];
+    @synchronized (self.connectedLinks) {
+        if (link == self.connectedLinks[[link _deviceInfo].id]) {
+            [self.connectedLinks removeObjectForKey:[link _deviceInfo].id];
+        }
+    }
+    // The peer might just have changed network, try to find it again right away
+    if ([link isKindOfClass:[LanLink class]] && [(LanLink *)link peerLost]) {
+        os_log_with_type(logger, OS_LOG_TYPE_INFO, "lp lost peer, refreshing discovery");
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self onRefresh];
+        });
     }
 }
 
@@ -341,7 +370,8 @@
 
     // Get ready to establish TCP connection to incoming host
     os_log_with_type(logger, self.debugLogLevel, "LanLinkProvider:id packet received, creating link and a TCP connection socket");
-    GCDAsyncSocket* socket=[[GCDAsyncSocket alloc] initWithDelegate:self delegateQueue:socketQueue];
+    GCDAsyncSocket* socket=[[GCDAsyncSocket alloc] initWithDelegate:self delegateQueue:[self newHandshakeQueue]];
+    socket.userData = np;
     uint16_t tcpPort=[np integerForKey:@"tcpPort"];
     if (tcpPort < MIN_TCP_PORT || tcpPort > MAX_TCP_PORT) {
         os_log_with_type(logger, OS_LOG_TYPE_INFO, "TCP port outside of kdeconnect's range");
@@ -384,7 +414,6 @@
     
     //add to pending connection list
     @synchronized(_pendingSockets) {
-        [_pendingNPs insertObject:np atIndex:0];
         [_pendingSockets insertObject:socket atIndex:0];
     }
 }
@@ -419,10 +448,13 @@
         [newSocket enableBackgroundingOnSocket];
     }];
 #endif
+    long index;
     @synchronized(_pendingSockets) {
         [_pendingSockets addObject:newSocket];
+        index=[_pendingSockets indexOfObject:newSocket];
     }
-    long index=[_pendingSockets indexOfObject:newSocket];
+    // Accepted sockets inherit the server's socketQueue, move the handshake off it
+    [newSocket setDelegateQueue:[self newHandshakeQueue]];
     //retrieve id packet
     [newSocket readDataToData:[GCDAsyncSocket LFData] withTimeout:-1 maxLength:MAX_IDENTITY_PACKET_SIZE tag:index];
 }
@@ -438,11 +470,13 @@
     os_log_with_type(logger, OS_LOG_TYPE_INFO, "tcp socket didConnectToHost %{mask.hash}@", host);
 
     //create LanLink and inform the background
-    NSUInteger index=[_pendingSockets indexOfObject:sock];
-    NetworkPacket* np=[_pendingNPs objectAtIndex:index];
+    NetworkPacket* np=(NetworkPacket *)sock.userData;
 #if !TARGET_OS_OSX
     NSString* deviceId=[np objectForKey:@"deviceId"];
-    BaseLink *link = self.connectedLinks[deviceId];
+    BaseLink *link;
+    @synchronized (self.connectedLinks) {
+        link = self.connectedLinks[deviceId];
+    }
     
     if (link) {
         // Last timing to enableBackgroundingOnSocket before stream opens
@@ -621,7 +655,9 @@
     NSString *deviceId = [np objectForKey:@"deviceId"];
     if (protocolVersion >= 8) {
         V8IdentityExchangeDelegate *delegate = [[V8IdentityExchangeDelegate alloc] init:self deviceId:deviceId protocolVersion:protocolVersion];
-        [self.v8delegates addObject:delegate];
+        @synchronized (_v8delegates) {
+            [_v8delegates addObject:delegate];
+        }
         NetworkPacket *myIdentity = [NetworkPacket createIdentityPacket];
         [sock writeData:[myIdentity serialize] withTimeout:0 tag:PACKET_TAG_IDENTITY];
         [sock setDelegate:delegate]; // the delegate will call finishAddingSocket
@@ -635,23 +671,49 @@
 {
     NSString *deviceId = [np objectForKey:@"deviceId"];
     SecCertificateRef cert = [[CertificateService shared] getTempRemoteCertWithDeviceId:deviceId];
+    if (cert == NULL) {
+        os_log_with_type(logger, OS_LOG_TYPE_FAULT, "No certificate stored for %{mask.hash}@ after TLS handshake", deviceId);
+        @synchronized(_pendingSockets) {
+            [_pendingSockets removeObject:sock];
+        }
+        [sock disconnect];
+        return;
+    }
     DeviceInfo* deviceInfo = [DeviceInfo fromNetworkPacket:np cert:cert];
 
-    // if existing LanLink exists, DON'T create a new one
-    LanLink *link = (LanLink *)self.connectedLinks[deviceId];
-    if (link) {
-        [link setSocket:sock];
-        // reuse existing link once socket secures
-        [[self _linkProviderDelegate] onDeviceIdentityUpdatePacketReceived:deviceInfo];
-        return;
-    } else {
-        // create LanLink and inform the background
-        link = [[LanLink alloc] init:sock deviceInfo:deviceInfo];
-        self.connectedLinks[deviceId] = link;
-        if ([self _linkProviderDelegate]) {
+    // Handshake is done, links and devices are only ever updated from socketQueue
+    dispatch_async(socketQueue, ^{
+        BOOL stillPending;
+        @synchronized(self->_pendingSockets) {
+            stillPending = [self->_pendingSockets containsObject:sock];
+            [self->_pendingSockets removeObject:sock];
+        }
+        if (!stillPending) {
+            // onStop or a disconnect got to this socket first
+            [sock disconnect];
+            return;
+        }
+        [sock setDelegateQueue:self->socketQueue];
+        // if existing LanLink exists, DON'T create a new one
+        LanLink *link;
+        BOOL reused;
+        @synchronized (self.connectedLinks) {
+            link = (LanLink *)self.connectedLinks[deviceId];
+            reused = link != nil;
+            if (!reused) {
+                link = [[LanLink alloc] init:sock deviceInfo:deviceInfo];
+                self.connectedLinks[deviceId] = link;
+            }
+        }
+        if (reused) {
+            [link setSocket:sock];
+            // reuse existing link once socket secures
+            [[self _linkProviderDelegate] onDeviceIdentityUpdatePacketReceived:deviceInfo];
+        } else if ([self _linkProviderDelegate]) {
+            // create LanLink and inform the background
             [[self _linkProviderDelegate] onConnectionReceived:link];
         }
-    }
+    });
 }
 
 // This gets called when we start server TLS reusing an old link, and
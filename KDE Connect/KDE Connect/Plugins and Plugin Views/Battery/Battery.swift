@@ -28,11 +28,8 @@ import AppKit
     @objc var remoteIsCharging: Bool = false
     @Published
     @objc var remoteThresholdEvent: Int = 0
-#if os(macOS)
-    var batteryObserver: BatteryObserver? = nil
-#endif
     
-    private let logger = Logger()
+    private static let logger = Logger(category: "Battery")
     
     @objc init(controlDevice: Device) {
         self.controlDevice = controlDevice
@@ -42,26 +39,19 @@ import AppKit
         self.sendBatteryStatusOut()
     }
     
+    // Shared by all instances, started by the first one
+    private static let batteryMonitor = BatteryMonitor()
+    
     @objc func startBatteryMonitoring() {
-#if !os(macOS)
-        UIDevice.current.isBatteryMonitoringEnabled = true
-        
-        // Tip: to add an observer with a function/selector in another class that is not self,
-        // simply replace both self in the call with the instance where the function is located
-        NotificationCenter.default.addObserver(self, selector: #selector(self.batteryStateDidChange(notification:)), name: UIDevice.batteryStateDidChangeNotification, object: UIDevice.current)
-        
-        NotificationCenter.default.addObserver(self, selector: #selector(self.batteryLevelDidChange(notification:)), name: UIDevice.batteryLevelDidChangeNotification, object: UIDevice.current)
-#else
-        self.batteryObserver = BatteryObserver(batteryInfoDidChange)
-#endif
+        _ = Self.batteryMonitor
     }
     
     @objc func onDevicePacketReceived(np: NetworkPacket) {
         if (np.type == .batteryRequest) {
-            logger.debug("Battery plugin received a force update request")
+            Self.logger.debug("Battery plugin received a force update request")
             sendBatteryStatusOut()
         } else if (np.type == .battery) { // received battery info from other device
-            logger.debug("Battery plugin received battery status from remote device")
+            Self.logger.debug("Battery plugin received battery status from remote device")
             DispatchQueue.main.async { [weak self] in
                 withAnimation {
                     guard let self = self else { return }
@@ -74,6 +64,16 @@ import AppKit
     }
     
     @objc func sendBatteryStatusOut() {
+        let np = Self.batteryStatusPacket()
+        guard let controlDevice = controlDevice else {
+            Self.logger.fault("Sending battery status with leaked instance, \(CFGetRetainCount(self)) references remaining")
+            return
+        }
+        controlDevice.send(np, tag: Int(PACKET_TAG_BATTERY))
+    }
+    
+    /// The same for every device, see `broadcastBatteryStatusAllDevices`.
+    static func batteryStatusPacket() -> NetworkPacket {
         let np: NetworkPacket = NetworkPacket(type: .battery)
 #if !os(macOS)
         let batteryLevel: Int = Int(UIDevice.current.batteryLevel * 100)
@@ -83,14 +83,14 @@ import AppKit
             np.setInteger(batteryLevel, forKey: "currentCharge")
             np.setBool((batteryStatus == .charging), forKey: "isCharging")
             np.setInteger(batteryThresholdEvent, forKey: "thresholdEvent")
-            logger.debug("Battery status accessed successfully, sending out:")
-            logger.debug("BatteryLevel=\(batteryLevel)")
-            logger.debug("BatteryisCharging=\(batteryStatus == .charging)")
+            Self.logger.debug("Battery status accessed successfully, sending out:")
+            Self.logger.debug("BatteryLevel=\(batteryLevel)")
+            Self.logger.debug("BatteryisCharging=\(batteryStatus == .charging)")
         } else {
             np.setInteger(0, forKey: "currentCharge")
             np.setBool(false, forKey: "isCharging")
             np.setInteger(0, forKey: "thresholdEvent")
-            logger.notice("Battery status reported as unknown, reporting 0 for all values")
+            Self.logger.notice("Battery status reported as unknown, reporting 0 for all values")
         }
 #else
         let internalFinder = InternalFinder()
@@ -112,21 +112,31 @@ import AppKit
             print("Battery status reported as unknown, reporting 0 for all values")
         }
 #endif
+        return np
+    }
+    
+    @objc func sendBatteryStatusRequest() {
+        let np = Self.batteryStatusRequestPacket()
         guard let controlDevice = controlDevice else {
-            logger.fault("Sending battery status with leaked instance, \(CFGetRetainCount(self)) references remaining")
+            Self.logger.fault("Requesting battery status with leaked instance, \(CFGetRetainCount(self)) references remaining")
             return
         }
-        controlDevice.send(np, tag: Int(PACKET_TAG_BATTERY))
+        controlDevice.send(np, tag: Int(PACKET_TAG_NORMAL))
     }
     
-    @objc func sendBatteryStatusRequest() {
+    static func batteryStatusRequestPacket() -> NetworkPacket {
         let np: NetworkPacket = NetworkPacket(type: .batteryRequest)
         np.setBool(true, forKey: "request")
-        guard let controlDevice = controlDevice else {
-            logger.fault("Requesting battery status with leaked instance, \(CFGetRetainCount(self)) references remaining")
-            return
+        return np
+    }
+    
+    static func broadcastToBatteryEnabledDevices(_ np: NetworkPacket, tag: Int) {
+        let results = backgroundService.broadcastPacket(np, tag: tag) { device in
+            (device._pluginsEnableStatus[.batteryRequest] as? Bool) ?? false
+        }
+        for (deviceId, queued) in results where !queued.boolValue {
+            Self.logger.info("Failed to send \(np.type.rawValue, privacy: .public) to \(deviceId, privacy: .private(mask: .hash))")
         }
-        controlDevice.send(np, tag: Int(PACKET_TAG_NORMAL))
     }
     
     var statusSFSymbolName: String {
@@ -180,23 +190,35 @@ import AppKit
 #endif
         }
     }
+}
+
+/// Observes the device's own battery once for the whole app, so each change is
+/// serialized once and broadcast to all devices instead of sent by every Battery instance.
+private class BatteryMonitor: NSObject {
+#if os(macOS)
+    private var batteryObserver: BatteryObserver? = nil
+#endif
     
-    // Global functions for setting up and responding to the device's own events when battery
-    // status changes
-    
+    override init() {
+        super.init()
 #if !os(macOS)
-    // When the state of the battery changes: plugged, unplugged, full charge, unknown
-    @objc func batteryStateDidChange(notification: Notification) {
-        sendBatteryStatusOut()
+        UIDevice.current.isBatteryMonitoringEnabled = true
+        
+        // When the state of the battery changes: plugged, unplugged, full charge, unknown
+        NotificationCenter.default.addObserver(self, selector: #selector(self.batteryDidChange(notification:)), name: UIDevice.batteryStateDidChangeNotification, object: UIDevice.current)
+        
+        // When the percentage level of the battery changes
+        NotificationCenter.default.addObserver(self, selector: #selector(self.batteryDidChange(notification:)), name: UIDevice.batteryLevelDidChangeNotification, object: UIDevice.current)
+#else
+        self.batteryObserver = BatteryObserver { _ in
+            broadcastBatteryStatusAllDevices()
+        }
+#endif
     }
     
-    // When the percentage level of the battery changes
-    @objc func batteryLevelDidChange(notification: Notification) {
-        sendBatteryStatusOut()
-    }
-#else
-    func batteryInfoDidChange(info: BatteryInfo) {
-        sendBatteryStatusOut()
+#if !os(macOS)
+    @objc func batteryDidChange(notification: Notification) {
+        broadcastBatteryStatusAllDevices()
     }
 #endif
 }
@@ -210,18 +232,11 @@ func startBatteryMonitoringAllDevices() {
     }
 }
 
+// Serialized once and shared by all devices, paired and reachable ones only
 func broadcastBatteryStatusAllDevices() {
-    for device in backgroundService._devices.values {
-        if (device.isPaired() && (device._pluginsEnableStatus[.batteryRequest] != nil) && (device._pluginsEnableStatus[.batteryRequest] as! Bool)) {
-            (device._plugins[.batteryRequest] as! Battery).sendBatteryStatusOut()
-        }
-    }
+    Battery.broadcastToBatteryEnabledDevices(Battery.batteryStatusPacket(), tag: Int(PACKET_TAG_BATTERY))
 }
 
 func requestBatteryStatusAllDevices() {
-    for device in backgroundService._devices.values {
-        if (device.isPaired() && (device._pluginsEnableStatus[.batteryRequest] != nil) && (device._pluginsEnableStatus[.batteryRequest] as! Bool)) {
-            (device._plugins[.batteryRequest] as! Battery).sendBatteryStatusRequest()
-        }
-    }
+    Battery.broadcastToBatteryEnabledDevices(Battery.batteryStatusRequestPacket(), tag: Int(PACKET_TAG_NORMAL))
 }
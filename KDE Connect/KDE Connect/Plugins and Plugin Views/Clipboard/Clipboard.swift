@@ -29,7 +29,7 @@ import AppKit
     
     @objc func onDevicePacketReceived(np: NetworkPacket) {
         if (np.type == .clipboard || np.type == .clipboardConnect) {
-            if (np.object(forKey: "content") != nil) {
+            if (np.bodyHasKey("content")) {
                 if (np.type == .clipboard) {
 #if !os(macOS)
                     UIPasteboard.general.string = np.object(forKey: "content") as? String
@@ -316,15 +316,24 @@ import CryptoKit
     }
 
     // FIXME: the temp remote cert functions are here because I dind't find a way to do this from Objective-C inside LanLink.
-    var tempRemoteCerts: [String: SecCertificate] = [:]
+    // Handshakes run on their own queues, so all access goes through tempRemoteCertsQueue
+    private var tempRemoteCerts: [String: SecCertificate] = [:]
+    private let tempRemoteCertsQueue = DispatchQueue(label: "org.kde.kdeconnect.queue.tempRemoteCerts")
 
     @objc func storeTempRemoteCert(fromTrust: SecTrust, deviceId: String) {
-        let remoteCert: SecCertificate = extractRemoteCertFromTrust(trust: fromTrust)!
-        tempRemoteCerts[deviceId] = remoteCert
+        guard let remoteCert = extractRemoteCertFromTrust(trust: fromTrust) else {
+            logger.error("Unable to extract remote certificate for \(deviceId, privacy: .private(mask: .hash))")
+            return
+        }
+        tempRemoteCertsQueue.sync {
+            tempRemoteCerts[deviceId] = remoteCert
+        }
     }
 
-    @objc func getTempRemoteCert(deviceId: String) -> SecCertificate {
-        return tempRemoteCerts[deviceId]!
+    @objc func getTempRemoteCert(deviceId: String) -> SecCertificate? {
+        return tempRemoteCertsQueue.sync {
+            tempRemoteCerts[deviceId]
+        }
     }
     
     // Unused and reference functions